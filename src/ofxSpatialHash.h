@@ -1,55 +1,165 @@
 #pragma once
 
 /**
- * @brief ofxSpatialHash Fast nearest neighbour lookup for 2d partical systems
+ * @brief ofxSpatialHash Fast nearest neighbour lookup for 2d and 3d partical systems
  * 
  * ### Restrictions
- * - 2d only.
- * - Points must be positive in x and y. 
- * - The spatial hash top left corner is anchored to 0,0.
- * - The class needs a predefined space width and height. Points outside this space will cause errors.
+ * - Points must be positive in every dimension.
+ * - The spatial hash top left corner is anchored to the origin.
+ * - The class needs a predefined world size. Points outside this space will cause errors.
  * - The returned points from a nearest neighbour search will contain points outside of the search radius.
  * - An extra distance check provided by the user is needed to make sure you have points contained inside the radius.
  * 
+ * ### Dimensions
+ * Dim defaults to 2. 2d hashes take x, y and 3d hashes take x, y, z in every function.
+ * Any dimension can use the overloads taking a Position, which is a std::array of Dim floats.
+ * 
+ * ### Aggregates
+ * When enabled in init() every bucket keeps a count, sum of weights, weighted centroid and bounding box of its points.
+ * countInRadius(), sumInRadius() and evaluateField() use these to skip whole buckets and only touch individual points
+ * in buckets on the boundary of the query.
+ * 
+ * ### Positions
+ * forEachPair() needs the position of every point. These are kept when either aggregates or storePositions is enabled in init().
+ * 
+ * ### Periodic
+ * When enabled with setPeriodic() the world wraps around at its edges. Points are wrapped into the world in addPoint(),
+ * queries near an edge also find the buckets on the opposite side and getDisplacement() returns minimum image offsets.
+ * Search radii should be at most half the world size.
+ * 
  * ### Dependency
  * The class is written without any openframeworks dependency and can be used in any system with an origin in the top left.
  * 
  * @tparam T Point data or a pointer to point data
+ * @tparam Dim Number of dimensions
  * 
  * @see http://www.cs.ucf.edu/~jmesit/publications/scsc%202005.pdf
 */
 #include <vector>
+#include <array>
 #include <cmath>
-template <class T>
+#include <algorithm>
+#include <type_traits>
+#include <cassert>
+template <class T, int Dim = 2>
 class ofxSpatialHash
 {
+	static_assert(Dim > 0, "ofxSpatialHash needs at least one dimension");
+
 public:
 
+	/**
+	 * @brief A point or offset with one float per dimension
+	*/
+	typedef std::array<float, Dim> Position;
+
+	/**
+	 * @brief Summary of the points in a bucket
+	 * @note Only maintained when aggregates are enabled in init()
+	*/
+	struct Aggregate
+	{
+		int count = 0;
+		float weight = 0;
+		Position centroid{};
+		Position boundsMin{};
+		Position boundsMax{};
+	};
+
 	/**
 	 * @brief Initialise a spatial hash
 	 * 
+	 * @param worldSize					The maximum size of the spatial hash in every dimension, starting at the origin
+	 * @param gridSize					A grid of buckets that is gridSize to the power of Dim
+	 * @param bucketPreallocationSize	Avoid syscall trading memory for time
+	 * @param useAggregates				Maintain per bucket aggregates and point positions in addPoint()
+	 * @param storePositions			Keep point positions in addPoint() for forEachPair() without the aggregates
+	 * 
+	 * @note Internally this sets up the array of buckets.
+	 * So that it will contain the correct amount of buckets for a given grid size
+	*/
+	void init(const Position& worldSize, float gridSize, int bucketPreallocationSize, bool useAggregates = false, bool storePositions = false);
+
+	/**
+	 * @brief Initialise a 2d spatial hash
+	 * 
 	 * @param worldWidth				The maximum width of the spatial hash, starting at 0,0
 	 * @param worldHeight				The maximum height of the the spatial hash, starting at 0,0
 	 * @param gridSize					A grid of buckets that is gridSize * gridSize
 	 * @param bucketPreallocationSize	Avoid syscall trading memory for time
+	 * @param useAggregates				Maintain per bucket aggregates and point positions in addPoint()
+	 * @param storePositions			Keep point positions in addPoint() for forEachPair() without the aggregates
+	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+	void init(float worldWidth, float worldHeight, float gridSize, int bucketPreallocationSize, bool useAggregates = false, bool storePositions = false);
+
+	/**
+	 * @brief Initialise a 3d spatial hash
 	 * 
-	 * @note Internally this sets up the array of buckets. 
-	 * So that it will contain the correct amount of buckets for a given grid size
+	 * @param worldWidth				The maximum width of the spatial hash, starting at 0,0,0
+	 * @param worldHeight				The maximum height of the the spatial hash, starting at 0,0,0
+	 * @param worldDepth				The maximum depth of the the spatial hash, starting at 0,0,0
+	 * @param gridSize					A grid of buckets that is gridSize * gridSize * gridSize
+	 * @param bucketPreallocationSize	Avoid syscall trading memory for time
+	 * @param useAggregates				Maintain per bucket aggregates and point positions in addPoint()
+	 * @param storePositions			Keep point positions in addPoint() for forEachPair() without the aggregates
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	void init(float worldWidth, float worldHeight, float worldDepth, float gridSize, int bucketPreallocationSize, bool useAggregates = false, bool storePositions = false);
+
+	/**
+	 * @brief Wrap the world around at its edges
+	 * @param periodic True for a toroidal world
+	 * 
+	 * @note Call before adding points
 	*/
-	void init(float worldWidth, float worldHeight, float gridSize, int bucketPreallocationSize);
+	void setPeriodic(bool periodic);
 
 	/**
 	 * @brief Add a value of type T to the spatial hash
+	 * @param position Point position
+	 * @param value Point value
+	 * @param weight Point weight eg. mass. Only used when aggregates are enabled
+	 * 
+	 * @note Typically type T would be a pointer to a point
+	*/
+	void addPoint(const Position& position, T value, float weight = 1.f);
+
+	/**
+	 * @brief Add a value of type T to a 2d spatial hash
 	 * @param x Point x
 	 * @param y Point y
 	 * @param value Point value
+	 * @param weight Point weight eg. mass. Only used when aggregates are enabled
 	 * 
 	 * @note Typically type T would be a pointer to a point
 	*/
-	void addPoint(float x, float y, T value);
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+	void addPoint(float x, float y, T value, float weight = 1.f);
+
+	/**
+	 * @brief Add a value of type T to a 3d spatial hash
+	 * @param x Point x
+	 * @param y Point y
+	 * @param z Point z
+	 * @param value Point value
+	 * @param weight Point weight eg. mass. Only used when aggregates are enabled
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	void addPoint(float x, float y, float z, T value, float weight = 1.f);
 
 	/**
 	 * @brief Fast point lookup
+	 * @param center Sphere center
+	 * @param radius Sphere radius
+	 * @return A referance to a vector of type T
+	 * 
+	 * @note This will return points outside of the sphere so an extra distance check is needed
+	*/
+	std::vector<T>& getNearestPoints(const Position& center, float radius);
+
+	/**
+	 * @brief Fast point lookup in a 2d spatial hash
 	 * @param x Circle center x
 	 * @param y Circle center y
 	 * @param radius Circle radius
@@ -58,33 +168,237 @@ public:
 	 * @note Use this to search a circular area for points. This will return points outside of the
 	 * circle so an extra distance check is needed eg. `ofVec2f::distance()` or `glm::distance()`
 	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
 	std::vector<T>& getNearestPoints(float x, float y, float radius);
 
 	/**
-	 * @brief Returns the bucket indices for a given circular search area
+	 * @brief Fast point lookup in a 3d spatial hash
+	 * @param x Sphere center x
+	 * @param y Sphere center y
+	 * @param z Sphere center z
+	 * @param radius Sphere radius
+	 * @return A referance to a vector of type T
+	 * 
+	 * @note This will return points outside of the sphere so an extra distance check is needed
+	 * eg. `ofVec3f::distance()` or `glm::distance()`
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	std::vector<T>& getNearestPoints(float x, float y, float z, float radius);
+
+	/**
+	 * @brief Returns the bucket indices for a given spherical search area
+	 * @param center Sphere center
+	 * @param radius Sphere radius
+	 * @return A vector of bucket indices
+	*/
+	std::vector<int>& getNearestBuckets(const Position& center, float radius);
+
+	/**
+	 * @brief Returns the bucket indices for a given circular search area in a 2d spatial hash
 	 * @param x Circle center x
 	 * @param y Circle center y
 	 * @param radius Circle radius
 	 * @return A vector of bucket indices
 	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
 	std::vector<int>& getNearestBuckets(float x, float y, float radius);
 
+	/**
+	 * @brief Returns the bucket indices for a given spherical search area in a 3d spatial hash
+	 * @param x Sphere center x
+	 * @param y Sphere center y
+	 * @param z Sphere center z
+	 * @param radius Sphere radius
+	 * @return A vector of bucket indices
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	std::vector<int>& getNearestBuckets(float x, float y, float z, float radius);
+
 	/**
 	 * @brief Get a bucket index for a given point
+	 * @param position Point position
+	 * @return Bucket index
+	*/
+	int getBucketIndex(const Position& position);
+
+	/**
+	 * @brief Get a bucket index for a given point in a 2d spatial hash
 	 * @param x Point x
 	 * @param y Point y
 	 * @return Bucket index
 	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
 	int getBucketIndex(float x, float y);
 
+	/**
+	 * @brief Get a bucket index for a given point in a 3d spatial hash
+	 * @param x Point x
+	 * @param y Point y
+	 * @param z Point z
+	 * @return Bucket index
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	int getBucketIndex(float x, float y, float z);
+
 	/**
 	 * @brief Get the bucket for given point
+	 * @param position Point position
+	 * @return A vector<T> bucket.
+	*/
+	std::vector<T>& getBucket(const Position& position);
+
+	/**
+	 * @brief Get the bucket for given point in a 2d spatial hash
 	 * @param x Point x
 	 * @param y Point y
 	 * @return A vector<T> bucket.
 	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
 	std::vector<T>& getBucket(float x, float y);
 
+	/**
+	 * @brief Get the bucket for given point in a 3d spatial hash
+	 * @param x Point x
+	 * @param y Point y
+	 * @param z Point z
+	 * @return A vector<T> bucket.
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	std::vector<T>& getBucket(float x, float y, float z);
+
+	/**
+	 * @brief Get the offset from one point to another
+	 * @param from From position
+	 * @param to To position
+	 * @param offset Returned offset
+	 * 
+	 * @note In periodic mode this is the offset to the nearest image of the second point
+	*/
+	void getDisplacement(const Position& from, const Position& to, Position& offset);
+
+	/**
+	 * @brief Get the offset from one point to another in a 2d spatial hash
+	 * @param x1 From x
+	 * @param y1 From y
+	 * @param x2 To x
+	 * @param y2 To y
+	 * @param dx Returned offset x
+	 * @param dy Returned offset y
+	 * 
+	 * @note In periodic mode this is the offset to the nearest image of the second point
+	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+	void getDisplacement(float x1, float y1, float x2, float y2, float& dx, float& dy);
+
+	/**
+	 * @brief Get the offset from one point to another in a 3d spatial hash
+	 * @note In periodic mode this is the offset to the nearest image of the second point
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	void getDisplacement(float x1, float y1, float z1, float x2, float y2, float z2, float& dx, float& dy, float& dz);
+
+	/**
+	 * @brief Get the aggregate of a bucket
+	 * @param index Bucket index
+	 * @return Count, sum of weights, weighted centroid and bounding box of the points in the bucket
+	 * 
+	 * @note Requires aggregates to be enabled in init(). Asserts otherwise and returns an empty aggregate in release builds
+	*/
+	const Aggregate& getAggregate(int index);
+
+	/**
+	 * @brief Count the points inside a sphere
+	 * @param center Sphere center
+	 * @param radius Sphere radius
+	 * @return Exact number of points within radius
+	 * 
+	 * @note Requires aggregates to be enabled in init(), asserts otherwise and returns 0 in release builds.
+	 * Buckets whose bounding box is fully inside or outside
+	 * of the sphere are counted from their aggregate without touching their points
+	*/
+	int countInRadius(const Position& center, float radius);
+
+	/**
+	 * @brief Count the points inside a circle in a 2d spatial hash
+	 * @see countInRadius(const Position&, float)
+	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+	int countInRadius(float x, float y, float radius);
+
+	/**
+	 * @brief Count the points inside a sphere in a 3d spatial hash
+	 * @see countInRadius(const Position&, float)
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	int countInRadius(float x, float y, float z, float radius);
+
+	/**
+	 * @brief Sum the weights of the points inside a sphere
+	 * @param center Sphere center
+	 * @param radius Sphere radius
+	 * @return Exact sum of the weights of points within radius
+	 * 
+	 * @note Requires aggregates to be enabled in init(), asserts otherwise and returns 0 in release builds
+	*/
+	float sumInRadius(const Position& center, float radius);
+
+	/**
+	 * @brief Sum the weights of the points inside a circle in a 2d spatial hash
+	 * @see sumInRadius(const Position&, float)
+	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+	float sumInRadius(float x, float y, float radius);
+
+	/**
+	 * @brief Sum the weights of the points inside a sphere in a 3d spatial hash
+	 * @see sumInRadius(const Position&, float)
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	float sumInRadius(float x, float y, float z, float radius);
+
+	/**
+	 * @brief Approximate field evaluation in the style of Barnes-Hut
+	 * @param position Evaluation point
+	 * @param theta Opening angle. A bucket whose bounding box size divided by its distance is below theta
+	 * is treated as a single point of its total weight at its centroid. 0 gives the exact result
+	 * @param kernel Called for every bucket or point contributing to the field with its offset from the evaluation point
+	 * as `kernel(float dx, float dy, float weight)` in 2d, `kernel(float dx, float dy, float dz, float weight)` in 3d
+	 * and `kernel(const Position& offset, float weight)` otherwise
+	 * 
+	 * @note Requires aggregates to be enabled in init(), asserts otherwise. Every bucket in the grid contributes.
+	 * A point at the evaluation point is passed with a zero offset so the kernel should handle it, eg. with softening.
+	 * In periodic mode offsets are minimum image offsets
+	*/
+	template <class F>
+	void evaluateField(const Position& position, float theta, F kernel);
+
+	/**
+	 * @brief Approximate field evaluation in a 2d spatial hash
+	 * @see evaluateField(const Position&, float, F)
+	*/
+	template <class F, int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+	void evaluateField(float x, float y, float theta, F kernel);
+
+	/**
+	 * @brief Approximate field evaluation in a 3d spatial hash
+	 * @see evaluateField(const Position&, float, F)
+	*/
+	template <class F, int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	void evaluateField(float x, float y, float z, float theta, F kernel);
+
+	/**
+	 * @brief Visit every pair of points within radius of each other exactly once
+	 * @param radius Pair distance
+	 * @param f Called as `f(T a, T b, float dx, float dy)` in 2d, `f(T a, T b, float dx, float dy, float dz)` in 3d
+	 * and `f(T a, T b, const Position& offset)` otherwise, where the offset points from a to b
+	 * 
+	 * @note Requires aggregates or storePositions to be enabled in init(), asserts otherwise.
+	 * Each bucket is only compared with the buckets around it,
+	 * 9 in 2d and 27 in 3d when the radius is no larger than a bucket. In periodic mode offsets are minimum image offsets
+	*/
+	template <class F>
+	void forEachPair(float radius, F f);
+
 	/**
 	 * @brief Clears the contents of every bucket.
 	 * @note Use this when you need to rebuild the spatial hash with new positions for every point
@@ -92,46 +406,164 @@ public:
 	void clear();
 
 private:
+	struct PointRecord
+	{
+		Position position;
+		float weight;
+	};
 	std::vector<std::vector<T>> m_buckets;
+	std::vector<std::vector<PointRecord>> m_bucketPoints;
+	std::vector<Aggregate> m_aggregates;
 	std::vector<int> m_bucketIndexReturnBuffer;
+	std::vector<int> m_pairBucketBuffer;
 	std::vector<T> m_returnBuffer;
 	float clip(float n, float lower, float upper);
-	float m_worldWidth = 0;
-	float m_worldHeight = 0;
+	float wrap(float n, float size);
+	float minimumImage(float d, float size);
+	int wrapCell(int n, int gridSize);
+	// Overloads on the dimension pick the unrolled 2d and 3d paths without needing if constexpr
+	typedef std::array<int, Dim> Cells;
+	void collectBucketRange(Position lower, Position upper, std::vector<int>& buckets);
+	void walkBucketRange(const Cells& first, const Cells& count, int gridSize, std::vector<int>& buckets, std::integral_constant<int, 2>);
+	void walkBucketRange(const Cells& first, const Cells& count, int gridSize, std::vector<int>& buckets, std::integral_constant<int, 3>);
+	template <int D>
+	void walkBucketRange(const Cells& first, const Cells& count, int gridSize, std::vector<int>& buckets, std::integral_constant<int, D>);
+	void accumulateInRadius(const Position& center, float radius, int& count, float& weight);
+	template <class F, class... Args>
+	void invokeKernel(std::integral_constant<int, 2>, F& kernel, const Position& offset, Args... args);
+	template <class F, class... Args>
+	void invokeKernel(std::integral_constant<int, 3>, F& kernel, const Position& offset, Args... args);
+	template <int D, class F, class... Args>
+	void invokeKernel(std::integral_constant<int, D>, F& kernel, const Position& offset, Args... args);
+	template <class F>
+	void invokePair(std::integral_constant<int, 2>, F& f, const T& a, const T& b, const Position& offset);
+	template <class F>
+	void invokePair(std::integral_constant<int, 3>, F& f, const T& a, const T& b, const Position& offset);
+	template <int D, class F>
+	void invokePair(std::integral_constant<int, D>, F& f, const T& a, const T& b, const Position& offset);
+	bool m_useAggregates = false;
+	bool m_storePositions = false;
+	bool m_periodic = false;
+	Position m_worldSize{};
+	Position m_cellSize{};
 	float m_gridSize = 0;
-	float m_cellWidth = 0;
-	float m_cellHeight = 0;
 };
 
-template<class T>
-inline void ofxSpatialHash<T>::init(float worldWidth, float worldHeight, float gridSize, int bucketPreallocationSize)
+template<class T, int Dim>
+inline void ofxSpatialHash<T, Dim>::init(const Position& worldSize, float gridSize, int bucketPreallocationSize, bool useAggregates, bool storePositions)
 {
-	m_worldWidth = worldWidth;
-	m_worldHeight = worldHeight;
+	m_worldSize = worldSize;
 	m_gridSize = gridSize;
-	m_cellWidth = m_worldWidth / m_gridSize;
-	m_cellHeight = m_worldHeight / m_gridSize;
+	for (int d = 0; d < Dim; d++)
+	{
+		m_cellSize[d] = m_worldSize[d] / m_gridSize;
+	}
 	m_buckets.clear();
-	for (size_t i = 0; i < std::pow(gridSize,2.f); i++)
+	for (size_t i = 0; i < std::pow(gridSize, static_cast<float>(Dim)); i++)
 	{
 		std::vector<T> bucket;
 		bucket.reserve(bucketPreallocationSize);
 		m_buckets.emplace_back(bucket);
 	}
+
+	m_useAggregates = useAggregates;
+	m_storePositions = storePositions || useAggregates;
+	m_bucketPoints.clear();
+	m_aggregates.clear();
+	if (m_useAggregates)
+	{
+		m_aggregates.resize(m_buckets.size());
+	}
+	if (m_storePositions)
+	{
+		for (size_t i = 0; i < m_buckets.size(); i++)
+		{
+			std::vector<PointRecord> points;
+			points.reserve(bucketPreallocationSize);
+			m_bucketPoints.emplace_back(points);
+		}
+	}
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline void ofxSpatialHash<T, Dim>::init(float worldWidth, float worldHeight, float gridSize, int bucketPreallocationSize, bool useAggregates, bool storePositions)
+{
+	init({ worldWidth, worldHeight }, gridSize, bucketPreallocationSize, useAggregates, storePositions);
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline void ofxSpatialHash<T, Dim>::init(float worldWidth, float worldHeight, float worldDepth, float gridSize, int bucketPreallocationSize, bool useAggregates, bool storePositions)
+{
+	init({ worldWidth, worldHeight, worldDepth }, gridSize, bucketPreallocationSize, useAggregates, storePositions);
+}
+
+template<class T, int Dim>
+inline void ofxSpatialHash<T, Dim>::setPeriodic(bool periodic)
+{
+	m_periodic = periodic;
 }
 
-template<class T>
-void ofxSpatialHash<T>::addPoint(float x, float y, T value)
+template<class T, int Dim>
+void ofxSpatialHash<T, Dim>::addPoint(const Position& position, T value, float weight)
 {
-	int index = getBucketIndex(x, y);
+	Position p = position;
+	if (m_periodic)
+	{
+		for (int d = 0; d < Dim; d++)
+		{
+			p[d] = wrap(p[d], m_worldSize[d]);
+		}
+	}
+	int index = getBucketIndex(p);
 	m_buckets[index].push_back(value);
+
+	if (m_storePositions)
+	{
+		m_bucketPoints[index].push_back({ p, weight });
+	}
+
+	if (m_useAggregates)
+	{
+		Aggregate& a = m_aggregates[index];
+		a.count++;
+		a.weight += weight;
+		if (a.count == 1)
+		{
+			a.centroid = a.boundsMin = a.boundsMax = p;
+			return;
+		}
+		// Running weighted mean. Zero weight points leave the centroid where it is
+		float t = a.weight != 0.f ? weight / a.weight : 0.f;
+		for (int d = 0; d < Dim; d++)
+		{
+			a.centroid[d] += (p[d] - a.centroid[d]) * t;
+			a.boundsMin[d] = std::min(a.boundsMin[d], p[d]);
+			a.boundsMax[d] = std::max(a.boundsMax[d], p[d]);
+		}
+	}
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline void ofxSpatialHash<T, Dim>::addPoint(float x, float y, T value, float weight)
+{
+	addPoint({ x, y }, value, weight);
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline void ofxSpatialHash<T, Dim>::addPoint(float x, float y, float z, T value, float weight)
+{
+	addPoint({ x, y, z }, value, weight);
 }
 
-template<class T>
-inline std::vector<T>& ofxSpatialHash<T>::getNearestPoints(float x, float y, float radius)
+template<class T, int Dim>
+inline std::vector<T>& ofxSpatialHash<T, Dim>::getNearestPoints(const Position& center, float radius)
 {
 	m_returnBuffer.clear();
-	m_bucketIndexReturnBuffer = getNearestBuckets(x, y, radius);
+	m_bucketIndexReturnBuffer = getNearestBuckets(center, radius);
 
 	for (auto& i : m_bucketIndexReturnBuffer)
 	{
@@ -140,67 +572,556 @@ inline std::vector<T>& ofxSpatialHash<T>::getNearestPoints(float x, float y, flo
 	return m_returnBuffer;
 }
 
-template<class T>
-inline std::vector<int>& ofxSpatialHash<T>::getNearestBuckets(float x, float y, float radius)
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline std::vector<T>& ofxSpatialHash<T, Dim>::getNearestPoints(float x, float y, float radius)
 {
-	m_bucketIndexReturnBuffer.clear();
+	return getNearestPoints({ x, y }, radius);
+}
 
-	// Screen space. Bounding box corners
-	float topLeftX = x - radius;
-	float topLeftY = y - radius;
-	float bottomRightX = x + radius;
-	float bottomRightY = y + radius;
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline std::vector<T>& ofxSpatialHash<T, Dim>::getNearestPoints(float x, float y, float z, float radius)
+{
+	return getNearestPoints({ x, y, z }, radius);
+}
 
-	// Grid space. Clip to stay inside grid
-	float gridTopLeftX = clip(topLeftX / m_cellWidth,0.f, m_gridSize - 1);
-	float gridTopLeftY = clip(topLeftY / m_cellHeight, 0.f, m_gridSize - 1);
-	float gridBottomRightX = clip(bottomRightX / m_cellWidth, 0.f, m_gridSize - 1);
-	float gridBottomRightY = clip(bottomRightY / m_cellHeight, 0.f, m_gridSize - 1);
+template<class T, int Dim>
+inline std::vector<int>& ofxSpatialHash<T, Dim>::getNearestBuckets(const Position& center, float radius)
+{
+	// Grid space. Bounding box corners
+	Position lower;
+	Position upper;
+	for (int d = 0; d < Dim; d++)
+	{
+		lower[d] = std::floor((center[d] - radius) / m_cellSize[d]);
+		upper[d] = std::floor((center[d] + radius) / m_cellSize[d]);
+	}
+	collectBucketRange(lower, upper, m_bucketIndexReturnBuffer);
+	return m_bucketIndexReturnBuffer;
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline std::vector<int>& ofxSpatialHash<T, Dim>::getNearestBuckets(float x, float y, float radius)
+{
+	return getNearestBuckets({ x, y }, radius);
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline std::vector<int>& ofxSpatialHash<T, Dim>::getNearestBuckets(float x, float y, float z, float radius)
+{
+	return getNearestBuckets({ x, y, z }, radius);
+}
+
+template<class T, int Dim>
+inline void ofxSpatialHash<T, Dim>::collectBucketRange(Position lower, Position upper, std::vector<int>& buckets)
+{
+	buckets.clear();
+	int gridSize = static_cast<int>(m_gridSize);
 
 	// Bounding box dimensions
-	float width = (std::floorf(gridBottomRightX)) - (std::floorf(gridTopLeftX)) + 1.f;
-	float height = (std::floorf(gridBottomRightY)) - (std::floorf(gridTopLeftY)) + 1.f;
+	Cells first;
+	Cells count;
+	for (int d = 0; d < Dim; d++)
+	{
+		if (m_periodic)
+		{
+			// Unclipped but never wider than the grid so every bucket is visited at most once
+			upper[d] = std::min(upper[d], lower[d] + m_gridSize - 1.f);
+		}
+		else
+		{
+			// Clip to stay inside grid
+			lower[d] = clip(lower[d], 0.f, m_gridSize - 1.f);
+			upper[d] = clip(upper[d], 0.f, m_gridSize - 1.f);
+		}
+		first[d] = static_cast<int>(lower[d]);
+		count[d] = static_cast<int>(upper[d] - lower[d]) + 1;
+	}
 
-	// Iterate over bounding box
-	for (size_t gx = 0; gx < width; gx++)
+	// Iterate over bounding box. Unrolled for 2d and 3d, wrapping into the grid in periodic mode
+	walkBucketRange(first, count, gridSize, buckets, std::integral_constant<int, Dim>());
+}
+
+template<class T, int Dim>
+inline void ofxSpatialHash<T, Dim>::walkBucketRange(const Cells& first, const Cells& count, int gridSize, std::vector<int>& buckets, std::integral_constant<int, 2>)
+{
+	for (int gx = 0; gx < count[0]; gx++)
 	{
-		for (size_t gy = 0; gy < height; gy++)
+		int gridX = wrapCell(first[0] + gx, gridSize);
+		for (int gy = 0; gy < count[1]; gy++)
 		{
-			// Translate from 0,0 to actual grid coordinates
-			float gridX = gx + std::floorf(gridTopLeftX);
-			float gridY = gy + std::floorf(gridTopLeftY);
-			// Get bucket index
-			int index = (gridY * m_gridSize) + gridX;
-			m_bucketIndexReturnBuffer.push_back(index);
+			int gridY = wrapCell(first[1] + gy, gridSize);
+			buckets.push_back(gridY * gridSize + gridX);
+		}
+	}
+}
+
+template<class T, int Dim>
+inline void ofxSpatialHash<T, Dim>::walkBucketRange(const Cells& first, const Cells& count, int gridSize, std::vector<int>& buckets, std::integral_constant<int, 3>)
+{
+	for (int gz = 0; gz < count[2]; gz++)
+	{
+		int gridZ = wrapCell(first[2] + gz, gridSize);
+		for (int gy = 0; gy < count[1]; gy++)
+		{
+			int gridY = wrapCell(first[1] + gy, gridSize);
+			int row = (gridZ * gridSize + gridY) * gridSize;
+			for (int gx = 0; gx < count[0]; gx++)
+			{
+				buckets.push_back(row + wrapCell(first[0] + gx, gridSize));
+			}
 		}
 	}
-	return m_bucketIndexReturnBuffer;
 }
 
-template<class T>
-int ofxSpatialHash<T>::getBucketIndex(float x, float y)
+template<class T, int Dim>
+template<int D>
+inline void ofxSpatialHash<T, Dim>::walkBucketRange(const Cells& first, const Cells& count, int gridSize, std::vector<int>& buckets, std::integral_constant<int, D>)
 {
-	int bucketID = static_cast<int>((std::floorf(x / m_cellWidth)) + (std::floorf(y / m_cellHeight)) * m_gridSize);
+	Cells offset{};
+	while (true)
+	{
+		int index = 0;
+		int stride = 1;
+		for (int d = 0; d < Dim; d++)
+		{
+			index += wrapCell(first[d] + offset[d], gridSize) * stride;
+			stride *= gridSize;
+		}
+		buckets.push_back(index);
+
+		// Step to the next cell, carrying into the next dimension
+		int d = 0;
+		while (d < Dim && ++offset[d] == count[d])
+		{
+			offset[d] = 0;
+			d++;
+		}
+		if (d == Dim)
+		{
+			break;
+		}
+	}
+}
+
+template<class T, int Dim>
+int ofxSpatialHash<T, Dim>::getBucketIndex(const Position& position)
+{
+	// Integer arithmetic so large grids match collectBucketRange() exactly
+	int gridSize = static_cast<int>(m_gridSize);
+	int bucketID = 0;
+	int stride = 1;
+	for (int d = 0; d < Dim; d++)
+	{
+		float p = m_periodic ? wrap(position[d], m_worldSize[d]) : position[d];
+		int cell = static_cast<int>(std::floor(p / m_cellSize[d]));
+		bucketID += cell * stride;
+		stride *= gridSize;
+	}
 	return bucketID;
 }
 
-template<class T>
-inline std::vector<T>& ofxSpatialHash<T>::getBucket(float x, float y)
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline int ofxSpatialHash<T, Dim>::getBucketIndex(float x, float y)
+{
+	return getBucketIndex({ x, y });
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline int ofxSpatialHash<T, Dim>::getBucketIndex(float x, float y, float z)
 {
-	int index = getBucketIndex(x, y);
+	return getBucketIndex({ x, y, z });
+}
+
+template<class T, int Dim>
+inline std::vector<T>& ofxSpatialHash<T, Dim>::getBucket(const Position& position)
+{
+	int index = getBucketIndex(position);
 	return m_buckets[index];
 }
 
-template<class T>
-inline void ofxSpatialHash<T>::clear()
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline std::vector<T>& ofxSpatialHash<T, Dim>::getBucket(float x, float y)
+{
+	return getBucket({ x, y });
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline std::vector<T>& ofxSpatialHash<T, Dim>::getBucket(float x, float y, float z)
+{
+	return getBucket({ x, y, z });
+}
+
+template<class T, int Dim>
+inline void ofxSpatialHash<T, Dim>::getDisplacement(const Position& from, const Position& to, Position& offset)
+{
+	for (int d = 0; d < Dim; d++)
+	{
+		offset[d] = to[d] - from[d];
+		if (m_periodic)
+		{
+			offset[d] = minimumImage(offset[d], m_worldSize[d]);
+		}
+	}
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline void ofxSpatialHash<T, Dim>::getDisplacement(float x1, float y1, float x2, float y2, float& dx, float& dy)
+{
+	Position offset;
+	getDisplacement({ x1, y1 }, { x2, y2 }, offset);
+	dx = offset[0];
+	dy = offset[1];
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline void ofxSpatialHash<T, Dim>::getDisplacement(float x1, float y1, float z1, float x2, float y2, float z2, float& dx, float& dy, float& dz)
+{
+	Position offset;
+	getDisplacement({ x1, y1, z1 }, { x2, y2, z2 }, offset);
+	dx = offset[0];
+	dy = offset[1];
+	dz = offset[2];
+}
+
+template<class T, int Dim>
+inline const typename ofxSpatialHash<T, Dim>::Aggregate& ofxSpatialHash<T, Dim>::getAggregate(int index)
+{
+	assert(m_useAggregates && "ofxSpatialHash::getAggregate() needs useAggregates in init()");
+	static const Aggregate empty;
+	if (!m_useAggregates)
+	{
+		return empty;
+	}
+	return m_aggregates[index];
+}
+
+template<class T, int Dim>
+inline int ofxSpatialHash<T, Dim>::countInRadius(const Position& center, float radius)
+{
+	int count = 0;
+	float weight = 0;
+	accumulateInRadius(center, radius, count, weight);
+	return count;
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline int ofxSpatialHash<T, Dim>::countInRadius(float x, float y, float radius)
+{
+	return countInRadius({ x, y }, radius);
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline int ofxSpatialHash<T, Dim>::countInRadius(float x, float y, float z, float radius)
+{
+	return countInRadius({ x, y, z }, radius);
+}
+
+template<class T, int Dim>
+inline float ofxSpatialHash<T, Dim>::sumInRadius(const Position& center, float radius)
+{
+	int count = 0;
+	float weight = 0;
+	accumulateInRadius(center, radius, count, weight);
+	return weight;
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline float ofxSpatialHash<T, Dim>::sumInRadius(float x, float y, float radius)
+{
+	return sumInRadius({ x, y }, radius);
+}
+
+template<class T, int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline float ofxSpatialHash<T, Dim>::sumInRadius(float x, float y, float z, float radius)
+{
+	return sumInRadius({ x, y, z }, radius);
+}
+
+template<class T, int Dim>
+inline void ofxSpatialHash<T, Dim>::accumulateInRadius(const Position& center, float radius, int& count, float& weight)
+{
+	assert(m_useAggregates && "ofxSpatialHash::countInRadius() and sumInRadius() need useAggregates in init()");
+	if (!m_useAggregates)
+	{
+		return;
+	}
+	float radiusSquared = radius * radius;
+	for (auto& i : getNearestBuckets(center, radius))
+	{
+		const Aggregate& a = m_aggregates[i];
+		if (a.count == 0)
+		{
+			continue;
+		}
+
+		// Offset to the bounding box center. In periodic mode this is the nearest image
+		Position half;
+		Position boxCenter;
+		for (int d = 0; d < Dim; d++)
+		{
+			half[d] = (a.boundsMax[d] - a.boundsMin[d]) * 0.5f;
+			boxCenter[d] = a.boundsMin[d] + half[d];
+		}
+		Position offset;
+		getDisplacement(center, boxCenter, offset);
+
+		// Closest and farthest point of the bounding box
+		float nearSquared = 0;
+		float farSquared = 0;
+		for (int d = 0; d < Dim; d++)
+		{
+			float nearD = std::max(std::abs(offset[d]) - half[d], 0.f);
+			float farD = std::abs(offset[d]) + half[d];
+			nearSquared += nearD * nearD;
+			farSquared += farD * farD;
+		}
+
+		// Bucket is fully outside of the sphere
+		if (nearSquared > radiusSquared)
+		{
+			continue;
+		}
+
+		// Bucket is fully inside of the sphere
+		if (farSquared <= radiusSquared)
+		{
+			count += a.count;
+			weight += a.weight;
+			continue;
+		}
+
+		// Boundary bucket
+		for (auto& p : m_bucketPoints[i])
+		{
+			getDisplacement(center, p.position, offset);
+			float distanceSquared = 0;
+			for (int d = 0; d < Dim; d++)
+			{
+				distanceSquared += offset[d] * offset[d];
+			}
+			if (distanceSquared <= radiusSquared)
+			{
+				count++;
+				weight += p.weight;
+			}
+		}
+	}
+}
+
+template<class T, int Dim>
+template<class F>
+inline void ofxSpatialHash<T, Dim>::evaluateField(const Position& position, float theta, F kernel)
+{
+	assert(m_useAggregates && "ofxSpatialHash::evaluateField() needs useAggregates in init()");
+	Position offset;
+	for (size_t i = 0; i < m_aggregates.size(); i++)
+	{
+		const Aggregate& a = m_aggregates[i];
+		if (a.count == 0)
+		{
+			continue;
+		}
+
+		// Opening criterion size / distance < theta, compared squared
+		getDisplacement(position, a.centroid, offset);
+		float size = 0;
+		float distanceSquared = 0;
+		for (int d = 0; d < Dim; d++)
+		{
+			size = std::max(size, a.boundsMax[d] - a.boundsMin[d]);
+			distanceSquared += offset[d] * offset[d];
+		}
+		if (size * size < theta * theta * distanceSquared)
+		{
+			invokeKernel(std::integral_constant<int, Dim>(), kernel, offset, a.weight);
+			continue;
+		}
+
+		for (auto& p : m_bucketPoints[i])
+		{
+			getDisplacement(position, p.position, offset);
+			invokeKernel(std::integral_constant<int, Dim>(), kernel, offset, p.weight);
+		}
+	}
+}
+
+template<class T, int Dim>
+template<class F, int D, typename std::enable_if<D == 2, int>::type>
+inline void ofxSpatialHash<T, Dim>::evaluateField(float x, float y, float theta, F kernel)
+{
+	evaluateField({ x, y }, theta, kernel);
+}
+
+template<class T, int Dim>
+template<class F, int D, typename std::enable_if<D == 3, int>::type>
+inline void ofxSpatialHash<T, Dim>::evaluateField(float x, float y, float z, float theta, F kernel)
+{
+	evaluateField({ x, y, z }, theta, kernel);
+}
+
+template<class T, int Dim>
+template<class F>
+inline void ofxSpatialHash<T, Dim>::forEachPair(float radius, F f)
+{
+	assert(m_storePositions && "ofxSpatialHash::forEachPair() needs useAggregates or storePositions in init()");
+	float radiusSquared = radius * radius;
+	int gridSize = static_cast<int>(m_gridSize);
+
+	// Number of buckets the radius reaches in each direction. 1 gives 3 * 3 in 2d and 3 * 3 * 3 in 3d
+	Position reach;
+	for (int d = 0; d < Dim; d++)
+	{
+		reach[d] = std::ceil(radius / m_cellSize[d]);
+	}
+
+	Position offset;
+	for (size_t a = 0; a < m_bucketPoints.size(); a++)
+	{
+		const std::vector<PointRecord>& pointsA = m_bucketPoints[a];
+		if (pointsA.empty())
+		{
+			continue;
+		}
+
+		// Bucket index to grid coordinates
+		Position lower;
+		Position upper;
+		int rest = static_cast<int>(a);
+		for (int d = 0; d < Dim; d++)
+		{
+			float cell = static_cast<float>(rest % gridSize);
+			rest /= gridSize;
+			lower[d] = cell - reach[d];
+			upper[d] = cell + reach[d];
+		}
+		collectBucketRange(lower, upper, m_pairBucketBuffer);
+
+		for (auto& b : m_pairBucketBuffer)
+		{
+			// Every pair of buckets once
+			if (b < static_cast<int>(a))
+			{
+				continue;
+			}
+			const std::vector<PointRecord>& pointsB = m_bucketPoints[b];
+			for (size_t i = 0; i < pointsA.size(); i++)
+			{
+				// Within the same bucket only compare with the points after i
+				size_t j = b == static_cast<int>(a) ? i + 1 : 0;
+				for (; j < pointsB.size(); j++)
+				{
+					getDisplacement(pointsA[i].position, pointsB[j].position, offset);
+					float distanceSquared = 0;
+					for (int d = 0; d < Dim; d++)
+					{
+						distanceSquared += offset[d] * offset[d];
+					}
+					if (distanceSquared <= radiusSquared)
+					{
+						invokePair(std::integral_constant<int, Dim>(), f, m_buckets[a][i], m_buckets[b][j], offset);
+					}
+				}
+			}
+		}
+	}
+}
+
+template<class T, int Dim>
+inline void ofxSpatialHash<T, Dim>::clear()
 {
 	for (auto& bucket : m_buckets)
 	{
 		bucket.clear();
 	}
+	for (auto& points : m_bucketPoints)
+	{
+		points.clear();
+	}
+	for (auto& a : m_aggregates)
+	{
+		a = Aggregate();
+	}
+}
+
+template<class T, int Dim>
+template<class F, class... Args>
+inline void ofxSpatialHash<T, Dim>::invokeKernel(std::integral_constant<int, 2>, F& kernel, const Position& offset, Args... args)
+{
+	kernel(offset[0], offset[1], args...);
+}
+
+template<class T, int Dim>
+template<class F, class... Args>
+inline void ofxSpatialHash<T, Dim>::invokeKernel(std::integral_constant<int, 3>, F& kernel, const Position& offset, Args... args)
+{
+	kernel(offset[0], offset[1], offset[2], args...);
+}
+
+template<class T, int Dim>
+template<int D, class F, class... Args>
+inline void ofxSpatialHash<T, Dim>::invokeKernel(std::integral_constant<int, D>, F& kernel, const Position& offset, Args... args)
+{
+	kernel(offset, args...);
+}
+
+template<class T, int Dim>
+template<class F>
+inline void ofxSpatialHash<T, Dim>::invokePair(std::integral_constant<int, 2>, F& f, const T& a, const T& b, const Position& offset)
+{
+	f(a, b, offset[0], offset[1]);
+}
+
+template<class T, int Dim>
+template<class F>
+inline void ofxSpatialHash<T, Dim>::invokePair(std::integral_constant<int, 3>, F& f, const T& a, const T& b, const Position& offset)
+{
+	f(a, b, offset[0], offset[1], offset[2]);
 }
 
-template<class T>
-float ofxSpatialHash<T>::clip(float n, float lower, float upper) {
+template<class T, int Dim>
+template<int D, class F>
+inline void ofxSpatialHash<T, Dim>::invokePair(std::integral_constant<int, D>, F& f, const T& a, const T& b, const Position& offset)
+{
+	f(a, b, offset);
+}
+
+template<class T, int Dim>
+float ofxSpatialHash<T, Dim>::clip(float n, float lower, float upper) {
 	return std::max(lower, std::min(n, upper));
+}
+
+template<class T, int Dim>
+float ofxSpatialHash<T, Dim>::wrap(float n, float size) {
+	float wrapped = n - size * std::floor(n / size);
+	// Rounding can land exactly on size for tiny negative values
+	return wrapped < size ? wrapped : 0.f;
+}
+
+template<class T, int Dim>
+float ofxSpatialHash<T, Dim>::minimumImage(float d, float size) {
+	return d - size * std::round(d / size);
+}
+
+template<class T, int Dim>
+int ofxSpatialHash<T, Dim>::wrapCell(int n, int gridSize) {
+	if (!m_periodic)
+	{
+		return n;
+	}
+	n %= gridSize;
+	return n < 0 ? n + gridSize : n;
 }
\ No newline at end of file
@@ -0,0 +1,319 @@
+#pragma once
+
+/**
+ * @brief ofxSpatialHashNeighborList Verlet neighbour lists for 2d and 3d partical systems built on top of ofxSpatialHash
+ *
+ * Every particle gets a compact array of the particles within radius + skin of it.
+ * The lists are reused across frames and only rebuilt once some particle has moved more than skin / 2
+ * since the last build, so most steps never touch the spatial hash.
+ * As long as no particle has moved further than skin / 2 every neighbour within radius is guaranteed to be in the list.
+ * Rebuilds use ofxSpatialHash::forEachPair() so every pair of points is only measured once.
+ *
+ * ### Restrictions
+ * - Same as ofxSpatialHash. Points must be positive and inside the predefined world size.
+ * - Neighbours are indices into the points vector passed to update(). The order of the points must not change between updates.
+ * - The lists contain neighbours up to radius + skin away.
+ * - An extra distance check provided by the user is needed to make sure you have points contained inside the radius.
+ * - In periodic mode radius + skin should be at most half the world size.
+ *
+ * @tparam Dim Number of dimensions
+ *
+ * @see https://doi.org/10.1103/PhysRev.159.98
+*/
+#include <vector>
+#include <array>
+#include <cmath>
+#include <type_traits>
+#include "ofxSpatialHash.h"
+
+template <int Dim = 2>
+class ofxSpatialHashNeighborList
+{
+public:
+	typedef typename ofxSpatialHash<int, Dim>::Position Position;
+
+	/**
+	 * @brief Initialise the neighbour list
+	 *
+	 * @param worldSize					The maximum size of the world in every dimension, starting at the origin
+	 * @param gridSize					A grid of buckets that is gridSize to the power of Dim used when rebuilding
+	 * @param radius					The interaction radius
+	 * @param skin						Extra distance added to the radius. Larger values rebuild less often but give longer lists
+	 * @param bucketPreallocationSize	Avoid syscall trading memory for time
+	*/
+	void init(const Position& worldSize, float gridSize, float radius, float skin, int bucketPreallocationSize);
+
+	/**
+	 * @brief Initialise a 2d neighbour list
+	 *
+	 * @param worldWidth				The maximum width of the world, starting at 0,0
+	 * @param worldHeight				The maximum height of the world, starting at 0,0
+	 * @param gridSize					A grid of buckets that is gridSize * gridSize used when rebuilding
+	 * @param radius					The interaction radius
+	 * @param skin						Extra distance added to the radius. Larger values rebuild less often but give longer lists
+	 * @param bucketPreallocationSize	Avoid syscall trading memory for time
+	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+	void init(float worldWidth, float worldHeight, float gridSize, float radius, float skin, int bucketPreallocationSize);
+
+	/**
+	 * @brief Initialise a 3d neighbour list
+	 *
+	 * @param worldWidth				The maximum width of the world, starting at 0,0,0
+	 * @param worldHeight				The maximum height of the world, starting at 0,0,0
+	 * @param worldDepth				The maximum depth of the world, starting at 0,0,0
+	 * @param gridSize					A grid of buckets that is gridSize * gridSize * gridSize used when rebuilding
+	 * @param radius					The interaction radius
+	 * @param skin						Extra distance added to the radius. Larger values rebuild less often but give longer lists
+	 * @param bucketPreallocationSize	Avoid syscall trading memory for time
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	void init(float worldWidth, float worldHeight, float worldDepth, float gridSize, float radius, float skin, int bucketPreallocationSize);
+
+	/**
+	 * @brief Wrap the world around at its edges
+	 * @param periodic True for a toroidal world
+	 *
+	 * @note Neighbours are found across the edges and displacements use the nearest image. Forces a rebuild on the next update()
+	*/
+	void setPeriodic(bool periodic);
+
+	/**
+	 * @brief Get the offset from one point to another
+	 * @note In periodic mode this is the offset to the nearest image of the second point
+	 * @see ofxSpatialHash::getDisplacement()
+	*/
+	void getDisplacement(const Position& from, const Position& to, Position& offset);
+
+	/**
+	 * @brief Get the offset from one point to another in a 2d neighbour list
+	 * @see ofxSpatialHash::getDisplacement()
+	*/
+	template <int D = Dim, typename std::enable_if<D == 2, int>::type = 0>
+	void getDisplacement(float x1, float y1, float x2, float y2, float& dx, float& dy);
+
+	/**
+	 * @brief Get the offset from one point to another in a 3d neighbour list
+	 * @see ofxSpatialHash::getDisplacement()
+	*/
+	template <int D = Dim, typename std::enable_if<D == 3, int>::type = 0>
+	void getDisplacement(float x1, float y1, float z1, float x2, float y2, float z2, float& dx, float& dy, float& dz);
+
+	/**
+	 * @brief Rebuild the lists if any point has moved more than skin / 2 since the last build
+	 * @param points Current point positions. Any type with an index operator eg. `ofVec2f`, `ofVec3f`, `glm::vec2` or `glm::vec3`
+	 * @return True if the lists were rebuilt
+	 *
+	 * @note Call this once per step before reading neighbours. Changing the number of points forces a rebuild.
+	*/
+	template <class P>
+	bool update(const std::vector<P>& points);
+
+	/**
+	 * @brief Rebuild the lists unconditionally
+	 * @param points Current point positions. Any type with an index operator eg. `ofVec2f`, `ofVec3f`, `glm::vec2` or `glm::vec3`
+	*/
+	template <class P>
+	void rebuild(const std::vector<P>& points);
+
+	/**
+	 * @brief Get the neighbours of a point
+	 * @param index Index of the point in the points vector
+	 * @return Pointer to the first of getNeighborCount() neighbour indices
+	*/
+	const int* getNeighbors(int index) const;
+
+	/**
+	 * @brief Get the number of neighbours of a point
+	 * @param index Index of the point in the points vector
+	 * @return Number of neighbours within radius + skin at the last build
+	*/
+	int getNeighborCount(int index) const;
+
+	/**
+	 * @brief Get the number of times the lists have been rebuilt since init()
+	*/
+	int getRebuildCount() const;
+
+private:
+	template <class P>
+	Position toPosition(const P& point);
+	void addPair(int a, int b);
+
+	// Accepts the 2d, 3d and generic forEachPair() signatures
+	struct PairCollector
+	{
+		ofxSpatialHashNeighborList* list;
+		void operator()(int a, int b, float, float) { list->addPair(a, b); }
+		void operator()(int a, int b, float, float, float) { list->addPair(a, b); }
+		void operator()(int a, int b, const Position&) { list->addPair(a, b); }
+	};
+
+	ofxSpatialHash<int, Dim> m_hash;
+	std::vector<int> m_offsets;
+	std::vector<int> m_neighbors;
+	std::vector<int> m_pairs;
+	std::vector<int> m_fill;
+	std::vector<Position> m_buildPositions;
+	float m_radius = 0;
+	float m_skin = 0;
+	int m_rebuildCount = 0;
+};
+
+template<int Dim>
+inline void ofxSpatialHashNeighborList<Dim>::init(const Position& worldSize, float gridSize, float radius, float skin, int bucketPreallocationSize)
+{
+	m_radius = radius;
+	m_skin = skin;
+	m_rebuildCount = 0;
+	m_offsets.clear();
+	m_neighbors.clear();
+	m_buildPositions.clear();
+	m_hash.init(worldSize, gridSize, bucketPreallocationSize, false, true);
+}
+
+template<int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline void ofxSpatialHashNeighborList<Dim>::init(float worldWidth, float worldHeight, float gridSize, float radius, float skin, int bucketPreallocationSize)
+{
+	init({ worldWidth, worldHeight }, gridSize, radius, skin, bucketPreallocationSize);
+}
+
+template<int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline void ofxSpatialHashNeighborList<Dim>::init(float worldWidth, float worldHeight, float worldDepth, float gridSize, float radius, float skin, int bucketPreallocationSize)
+{
+	init({ worldWidth, worldHeight, worldDepth }, gridSize, radius, skin, bucketPreallocationSize);
+}
+
+template<int Dim>
+inline void ofxSpatialHashNeighborList<Dim>::setPeriodic(bool periodic)
+{
+	m_hash.setPeriodic(periodic);
+	m_buildPositions.clear();
+}
+
+template<int Dim>
+inline void ofxSpatialHashNeighborList<Dim>::getDisplacement(const Position& from, const Position& to, Position& offset)
+{
+	m_hash.getDisplacement(from, to, offset);
+}
+
+template<int Dim>
+template<int D, typename std::enable_if<D == 2, int>::type>
+inline void ofxSpatialHashNeighborList<Dim>::getDisplacement(float x1, float y1, float x2, float y2, float& dx, float& dy)
+{
+	m_hash.getDisplacement(x1, y1, x2, y2, dx, dy);
+}
+
+template<int Dim>
+template<int D, typename std::enable_if<D == 3, int>::type>
+inline void ofxSpatialHashNeighborList<Dim>::getDisplacement(float x1, float y1, float z1, float x2, float y2, float z2, float& dx, float& dy, float& dz)
+{
+	m_hash.getDisplacement(x1, y1, z1, x2, y2, z2, dx, dy, dz);
+}
+
+template<int Dim>
+template<class P>
+inline bool ofxSpatialHashNeighborList<Dim>::update(const std::vector<P>& points)
+{
+	if (m_buildPositions.size() != points.size())
+	{
+		rebuild(points);
+		return true;
+	}
+
+	// Compare squared displacements to avoid a sqrt per point
+	float maxDisplacement = (m_skin * 0.5f) * (m_skin * 0.5f);
+	Position offset;
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		m_hash.getDisplacement(m_buildPositions[i], toPosition(points[i]), offset);
+		float displacement = 0;
+		for (int d = 0; d < Dim; d++)
+		{
+			displacement += offset[d] * offset[d];
+		}
+		if (displacement > maxDisplacement)
+		{
+			rebuild(points);
+			return true;
+		}
+	}
+	return false;
+}
+
+template<int Dim>
+template<class P>
+inline void ofxSpatialHashNeighborList<Dim>::rebuild(const std::vector<P>& points)
+{
+	m_rebuildCount++;
+	m_hash.clear();
+	m_buildPositions.resize(points.size());
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		m_buildPositions[i] = toPosition(points[i]);
+		m_hash.addPoint(m_buildPositions[i], static_cast<int>(i));
+	}
+
+	// Every pair within radius + skin once, counting neighbours per point
+	m_pairs.clear();
+	m_offsets.assign(points.size() + 1, 0);
+	float cutoff = m_radius + m_skin;
+	PairCollector collector = { this };
+	m_hash.forEachPair(cutoff, collector);
+
+	// Compressed layout. Neighbours of point i are m_neighbors[m_offsets[i]] to m_neighbors[m_offsets[i + 1]]
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		m_offsets[i + 1] += m_offsets[i];
+	}
+	m_neighbors.resize(m_pairs.size());
+	m_fill.assign(m_offsets.begin(), m_offsets.end() - 1);
+	for (size_t i = 0; i < m_pairs.size(); i += 2)
+	{
+		int a = m_pairs[i];
+		int b = m_pairs[i + 1];
+		m_neighbors[m_fill[a]++] = b;
+		m_neighbors[m_fill[b]++] = a;
+	}
+}
+
+template<int Dim>
+inline const int* ofxSpatialHashNeighborList<Dim>::getNeighbors(int index) const
+{
+	return m_neighbors.data() + m_offsets[index];
+}
+
+template<int Dim>
+inline int ofxSpatialHashNeighborList<Dim>::getNeighborCount(int index) const
+{
+	return m_offsets[index + 1] - m_offsets[index];
+}
+
+template<int Dim>
+inline int ofxSpatialHashNeighborList<Dim>::getRebuildCount() const
+{
+	return m_rebuildCount;
+}
+
+template<int Dim>
+inline void ofxSpatialHashNeighborList<Dim>::addPair(int a, int b)
+{
+	m_pairs.push_back(a);
+	m_pairs.push_back(b);
+	m_offsets[a + 1]++;
+	m_offsets[b + 1]++;
+}
+
+template<int Dim>
+template<class P>
+inline typename ofxSpatialHashNeighborList<Dim>::Position ofxSpatialHashNeighborList<Dim>::toPosition(const P& point)
+{
+	Position position;
+	for (int d = 0; d < Dim; d++)
+	{
+		position[d] = point[d];
+	}
+	return position;
+}
@@ -15,6 +15,10 @@ void ofxSpacialHash_Test::init(float width, float height, float gridSize, int nu
 
 	std::cout << "Running performace tests\n";
 	spatialTest(1000, 1000, 10, 0);
+	neighborListTest(1000, 1000, 50);
+	aggregateTest(1000, 1000, 10);
+	periodicTest(1000, 1000, 10);
+	spatialTest3d(1000, 1000, 1000, 50);
 
 	m_worldWidth = width;
 	m_worldHeight = height;
@@ -476,3 +480,358 @@ void spatialTest(float worldW, float worldH, float gridSize, int preAllocSize)
 		}
 	}
 }
+
+
+void neighborListTest(float worldW, float worldH, float gridSize)
+{
+	using namespace std::chrono;
+	using namespace std;
+	std::array<int, 4> numPoints = { 1000, 10'000, 50'000, 100'000 };
+
+	float radius = 10;
+	float skin = 4;
+	float stepSize = 0.5f;
+	int steps = 100;
+
+	cout << "Neighbour list. [Radius] " << radius << " [Skin] " << skin << " [Steps] " << steps << endl;
+	cout << "   \t[getNearestPoints every step]  ";
+	cout << "   [neighbour list]  ";
+	cout << "   [rebuilds]  ";
+	cout << "\n";
+
+	for (size_t i = 0; i < numPoints.size(); i++)
+	{
+		cout << "[Num Points] = " << numPoints[i];
+		ofSeedRandom(3286428356);
+		std::vector<glm::vec2> points;
+		for (size_t j = 0; j < numPoints[i]; j++)
+		{
+			points.push_back({ ofRandom(worldW), ofRandom(worldH) });
+		}
+		std::vector<glm::vec2> startPoints = points;
+
+		// Random walk that stays inside the world
+		auto step = [&]()
+		{
+			for (auto& p : points)
+			{
+				p.x = ofClamp(p.x + ofRandom(-stepSize, stepSize), 0.f, worldW - 1.f);
+				p.y = ofClamp(p.y + ofRandom(-stepSize, stepSize), 0.f, worldH - 1.f);
+			}
+		};
+
+		unsigned int hashInRadiusCount = 0;
+		{
+			ofSeedRandom(3286428356);
+			ofxSpatialHash<glm::vec2*> hash;
+			hash.init(worldW, worldH, gridSize, 100);
+			steady_clock::time_point begin = steady_clock::now();
+			for (int s = 0; s < steps; s++)
+			{
+				step();
+				hash.clear();
+				for (auto& p : points)
+				{
+					hash.addPoint(p.x, p.y, &p);
+				}
+				for (auto& p : points)
+				{
+					for (const auto& n : hash.getNearestPoints(p.x, p.y, radius))
+					{
+						if (n != &p && glm::distance(*n, p) < radius)
+						{
+							hashInRadiusCount++;
+						}
+					}
+				}
+			}
+			steady_clock::time_point end = steady_clock::now();
+			cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+		}
+
+		points = startPoints;
+		unsigned int listInRadiusCount = 0;
+		{
+			ofSeedRandom(3286428356);
+			ofxSpatialHashNeighborList<> neighborList;
+			neighborList.init(worldW, worldH, gridSize, radius, skin, 100);
+			steady_clock::time_point begin = steady_clock::now();
+			for (int s = 0; s < steps; s++)
+			{
+				step();
+				neighborList.update(points);
+				for (size_t j = 0; j < points.size(); j++)
+				{
+					const int* neighbors = neighborList.getNeighbors(j);
+					for (int n = 0; n < neighborList.getNeighborCount(j); n++)
+					{
+						if (glm::distance(points[neighbors[n]], points[j]) < radius)
+						{
+							listInRadiusCount++;
+						}
+					}
+				}
+			}
+			steady_clock::time_point end = steady_clock::now();
+			cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+			cout << " [Rebuilds] = " << neighborList.getRebuildCount();
+		}
+
+		// Both methods must find exactly the same neighbours
+		cout << " [Match] = " << (hashInRadiusCount == listInRadiusCount) << "\n";
+	}
+}
+
+void aggregateTest(float worldW, float worldH, float gridSize)
+{
+	using namespace std::chrono;
+	using namespace std;
+	std::array<int, 5> numPoints = { 10'000, 100'000, 500'000, 1'000'000, 10'000'000 };
+
+	float searchRadius = 150;
+	glm::vec2 center{ worldW / 2.f, worldH / 2.f };
+
+	cout << "Aggregates. [Search Radius] " << searchRadius << endl;
+	cout << "   \t[getNearestPoints count]  ";
+	cout << "   [countInRadius]  ";
+	cout << "   [evaluateField theta 0]  ";
+	cout << "   [evaluateField theta 0.5]  ";
+	cout << "\n";
+
+	for (size_t i = 0; i < numPoints.size(); i++)
+	{
+		cout << "[Num Points] = " << numPoints[i];
+		ofSeedRandom(3286428356);
+		std::vector<glm::vec2> points;
+		ofxSpatialHash<glm::vec2*> hash;
+		hash.init(worldW, worldH, gridSize, 100'000, true);
+		for (size_t j = 0; j < numPoints[i]; j++)
+		{
+			points.push_back({ ofRandom(worldW) , ofRandom(worldH) });
+		}
+		for (auto& p : points)
+		{
+			hash.addPoint(p.x, p.y, &p);
+		}
+
+		steady_clock::time_point begin = steady_clock::now();
+		int inRadiusCount = 0;
+		for (const auto& p : hash.getNearestPoints(center.x, center.y, searchRadius))
+		{
+			if (glm::distance(*p, center) <= searchRadius)
+			{
+				inRadiusCount++;
+			}
+		}
+		steady_clock::time_point end = steady_clock::now();
+		cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+
+		begin = steady_clock::now();
+		int aggregateCount = hash.countInRadius(center.x, center.y, searchRadius);
+		end = steady_clock::now();
+		cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+
+		// Softened inverse square force towards every point
+		glm::vec2 exactForce{ 0, 0 };
+		auto exactKernel = [&](float dx, float dy, float weight)
+		{
+			float d = dx * dx + dy * dy + 1.f;
+			exactForce += glm::vec2(dx, dy) * weight / (d * std::sqrt(d));
+		};
+		begin = steady_clock::now();
+		hash.evaluateField(center.x, center.y, 0.f, exactKernel);
+		end = steady_clock::now();
+		cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+
+		glm::vec2 approxForce{ 0, 0 };
+		auto approxKernel = [&](float dx, float dy, float weight)
+		{
+			float d = dx * dx + dy * dy + 1.f;
+			approxForce += glm::vec2(dx, dy) * weight / (d * std::sqrt(d));
+		};
+		begin = steady_clock::now();
+		hash.evaluateField(center.x, center.y, 0.5f, approxKernel);
+		end = steady_clock::now();
+		cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+
+		cout << " [Match] = " << (inRadiusCount == aggregateCount);
+		cout << " [Field Error] = " << glm::distance(exactForce, approxForce) / glm::length(exactForce) << "\n";
+	}
+}
+
+
+void periodicTest(float worldW, float worldH, float gridSize)
+{
+	using namespace std::chrono;
+	using namespace std;
+	std::array<int, 4> numPoints = { 10'000, 100'000, 500'000, 1'000'000 };
+
+	float searchRadius = 150;
+	glm::vec2 center{ worldW / 2.f, worldH / 2.f };
+	glm::vec2 corner{ 0.f, 0.f };
+
+	cout << "Periodic. [Search Radius] " << searchRadius << endl;
+	cout << "   \t[center getNearestPoints]  ";
+	cout << "   [corner getNearestPoints]  ";
+	cout << "   [corner countInRadius]  ";
+	cout << "\n";
+
+	for (size_t i = 0; i < numPoints.size(); i++)
+	{
+		cout << "[Num Points] = " << numPoints[i];
+		ofSeedRandom(3286428356);
+		std::vector<glm::vec2> points;
+		ofxSpatialHash<glm::vec2*> hash;
+		hash.init(worldW, worldH, gridSize, 100'000, true);
+		hash.setPeriodic(true);
+		for (size_t j = 0; j < numPoints[i]; j++)
+		{
+			points.push_back({ ofRandom(worldW) , ofRandom(worldH) });
+		}
+		for (auto& p : points)
+		{
+			hash.addPoint(p.x, p.y, &p);
+		}
+
+		// Interior and corner queries should cost the same
+		auto nearestCount = [&](glm::vec2 query)
+		{
+			int inRadiusCount = 0;
+			steady_clock::time_point begin = steady_clock::now();
+			for (const auto& p : hash.getNearestPoints(query.x, query.y, searchRadius))
+			{
+				float dx;
+				float dy;
+				hash.getDisplacement(query.x, query.y, p->x, p->y, dx, dy);
+				if (dx * dx + dy * dy <= searchRadius * searchRadius)
+				{
+					inRadiusCount++;
+				}
+			}
+			steady_clock::time_point end = steady_clock::now();
+			cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+			return inRadiusCount;
+		};
+		nearestCount(center);
+		int cornerCount = nearestCount(corner);
+
+		steady_clock::time_point begin = steady_clock::now();
+		int aggregateCount = hash.countInRadius(corner.x, corner.y, searchRadius);
+		steady_clock::time_point end = steady_clock::now();
+		cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+
+		// Brute force minimum image count
+		int naiveCount = 0;
+		for (auto& p : points)
+		{
+			float dx = p.x - corner.x;
+			float dy = p.y - corner.y;
+			dx -= worldW * std::round(dx / worldW);
+			dy -= worldH * std::round(dy / worldH);
+			if (dx * dx + dy * dy <= searchRadius * searchRadius)
+			{
+				naiveCount++;
+			}
+		}
+		cout << " [Match] = " << (cornerCount == naiveCount && aggregateCount == naiveCount) << "\n";
+	}
+}
+
+void spatialTest3d(float worldW, float worldH, float worldD, float gridSize)
+{
+	using namespace std::chrono;
+	using namespace std;
+	std::array<int, 6> numPoints = { 1000, 10'000, 50'000, 100'000, 500'000, 1'000'000 };
+
+	float searchRadius = 150;
+	float pairRadius = 20;
+	glm::vec3 center{ worldW / 2.f, worldH / 2.f, worldD / 2.f };
+
+	cout << "3d. [World Depth] " << worldD << " [Search Radius] " << searchRadius << " [Pair Radius] " << pairRadius << endl;
+	cout << "   \t[add point]  ";
+	cout << "   [hash sphere]  ";
+	cout << "   [naive sphere]  ";
+	cout << "   [hash pairs]  ";
+	cout << "   [naive pairs]  ";
+	cout << "\n";
+
+	for (size_t i = 0; i < numPoints.size(); i++)
+	{
+		cout << "[Num Points] = " << numPoints[i];
+		ofSeedRandom(3286428356);
+		std::vector<glm::vec3> points;
+		for (size_t j = 0; j < numPoints[i]; j++)
+		{
+			points.push_back({ ofRandom(worldW), ofRandom(worldH), ofRandom(worldD) });
+		}
+
+		ofxSpatialHash<glm::vec3*, 3> hash;
+		hash.init(worldW, worldH, worldD, gridSize, 16, false, true);
+		steady_clock::time_point begin = steady_clock::now();
+		for (auto& p : points)
+		{
+			hash.addPoint(p.x, p.y, p.z, &p);
+		}
+		steady_clock::time_point end = steady_clock::now();
+		cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+
+		int hashInRadiusCount = 0;
+		begin = steady_clock::now();
+		for (const auto& p : hash.getNearestPoints(center.x, center.y, center.z, searchRadius))
+		{
+			if (glm::distance(*p, center) <= searchRadius)
+			{
+				hashInRadiusCount++;
+			}
+		}
+		end = steady_clock::now();
+		cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+
+		int naiveInRadiusCount = 0;
+		begin = steady_clock::now();
+		for (const auto& p : points)
+		{
+			if (glm::distance(p, center) <= searchRadius)
+			{
+				naiveInRadiusCount++;
+			}
+		}
+		end = steady_clock::now();
+		cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+
+		// Pair sweep over the 27 buckets around each bucket
+		int hashPairCount = 0;
+		begin = steady_clock::now();
+		hash.forEachPair(pairRadius, [&](glm::vec3*, glm::vec3*, float, float, float)
+		{
+			hashPairCount++;
+		});
+		end = steady_clock::now();
+		cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+
+		bool isMatch = hashInRadiusCount == naiveInRadiusCount;
+		if (numPoints[i] > 50'000)
+		{
+			cout << " none ";
+		}
+		else
+		{
+			int naivePairCount = 0;
+			begin = steady_clock::now();
+			for (size_t a = 0; a < points.size(); a++)
+			{
+				for (size_t b = a + 1; b < points.size(); b++)
+				{
+					if (glm::distance(points[a], points[b]) <= pairRadius)
+					{
+						naivePairCount++;
+					}
+				}
+			}
+			end = steady_clock::now();
+			cout << " [Ms] = " << (float)duration_cast<microseconds>(end - begin).count() / 1000.f;
+			isMatch = isMatch && hashPairCount == naivePairCount;
+		}
+		cout << " [Match] = " << isMatch << "\n";
+	}
+}
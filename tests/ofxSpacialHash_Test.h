@@ -1,8 +1,13 @@
 #pragma once
 #include "ofMain.h"
 #include <ofxSpatialHash.h>
+#include <ofxSpatialHashNeighborList.h>
 
 void spatialTest(float worldW, float worldH, float gridSize, int preAllocSize);
+void neighborListTest(float worldW, float worldH, float gridSize);
+void aggregateTest(float worldW, float worldH, float gridSize);
+void periodicTest(float worldW, float worldH, float gridSize);
+void spatialTest3d(float worldW, float worldH, float worldD, float gridSize);
 
 class ofxSpacialHash_Test
 {